@@ -1,6 +1,39 @@
 ﻿#include <vector>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <string>
+#include <exception>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// SSE2 is part of every x64 target and of x86 builds with /arch:SSE2 or -msse2
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_SSE2
+#include <emmintrin.h>
+#endif
 
 struct Color {
     float r, g, b;
@@ -12,43 +45,162 @@ struct Color {
     ~Color() { };
 };
 
-class Image
+// Fixed set of worker threads for ParallelFor. Indices are claimed from a shared
+// counter, so faster threads simply take more of them. The calling thread works too.
+// Jobs must not call ParallelFor themselves. If a job throws, the remaining indices
+// are skipped and ParallelFor rethrows the first exception after every worker stopped.
+class ThreadPool
 {
 public:
-    Image(int width, int height)
-        : m_width(width), m_height(height), m_colors(std::vector<Color>(width* height)) { };
+    explicit ThreadPool(int threads = static_cast<int>(std::thread::hardware_concurrency())) {
+        for (int i = 1; i < threads; i++)
+        {
+            m_workers.emplace_back([this] { WorkerLoop(); });
+        }
+    };
 
-    ~Image() { };
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
 
-    Color GetColor(int x, int y) const {
-        return m_colors[y * m_width + x];
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (auto& w : m_workers)
+        {
+            w.join();
+        }
     };
 
-    void SetColor(const Color& color, int x, int y) {
-        m_colors[y * m_width + x].r = color.r;
-        m_colors[y * m_width + x].g = color.g;
-        m_colors[y * m_width + x].b = color.b;
+    static ThreadPool& Instance() {
+        static ThreadPool pool;
+        return pool;
     };
 
-    void Export(const char* path) const {
-        std::ofstream f;
-        f.open(path, std::ios::out | std::ios::binary);
+    int GetSize() const {
+        return static_cast<int>(m_workers.size()) + 1;
+    };
 
-        if (!f.is_open())
+    // Calls f(i) for every i in [0, count)
+    template <typename F>
+    void ParallelFor(int count, const F& f) {
+        if (m_workers.empty() || count < 2)
         {
-            std::cout << "File could not be opened\n";
+            for (int i = 0; i < count; i++)
+            {
+                f(i);
+            }
             return;
         }
 
-        unsigned char bmpPad[3] = { 0, 0, 0 };
-        const int paddingAmount = ((4 - (m_width * 3) % 4) % 4);
+        std::lock_guard<std::mutex> submit(m_submitMutex);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = [&f](int i) { f(i); };
+            m_jobCount = count;
+            m_next = 0;
+            m_finished = 0;
+            m_error = nullptr;
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        RunJob();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_finished == m_workers.size(); });
+        m_job = nullptr;
+
+        std::exception_ptr error = m_error;
+        m_error = nullptr;
+        lock.unlock();
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    };
+
+private:
+    void RunJob() {
+        try
+        {
+            for (int i = m_next++; i < m_jobCount; i = m_next++)
+            {
+                m_job(i);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error)
+            {
+                m_error = std::current_exception();
+            }
+            m_next = m_jobCount;
+        }
+    };
+
+    void WorkerLoop() {
+        unsigned long long seen = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait(lock, [&] { return m_stopping || m_generation != seen; });
+            if (m_stopping)
+            {
+                return;
+            }
+            seen = m_generation;
+
+            lock.unlock();
+            RunJob();
+            lock.lock();
+
+            if (++m_finished == m_workers.size())
+            {
+                m_done.notify_one();
+            }
+        }
+    };
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_submitMutex;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::function<void(int)> m_job;
+    int m_jobCount = 0;
+    std::atomic<int> m_next{ 0 };
+    size_t m_finished = 0;
+    std::exception_ptr m_error;
+    unsigned long long m_generation = 0;
+    bool m_stopping = false;
+};
+
+// Layout of 24-bit BMP files written by Export
+class Bmp
+{
+public:
+    static const int fileHeaderSize = 14;
+    static const int informationHeaderSize = 40;
+    static const int headerSize = fileHeaderSize + informationHeaderSize;
 
-        const int fileHeaderSize = 14;
-        const int informationHeaderSize = 40;
-        const int fileSize = fileHeaderSize + informationHeaderSize + m_width * m_height * 3 + paddingAmount * m_height;
+    // Bytes per 24-bit row, padded to a multiple of 4
+    static int RowSize(int width) {
+        return (width * 3 + 3) & ~3;
+    };
 
-        unsigned char fileHeader[fileHeaderSize];
+    // Writes the 54-byte file + information header of a 24-bit BMP. A negative height
+    // marks a top-down file. Files over 4 GB store 0 as their size, which readers accept
+    // because the size field is informational.
+    static void WriteHeader(unsigned char* header, int width, int height) {
+        const std::uint64_t rows = height < 0 ? -static_cast<std::int64_t>(height) : height;
+        const std::uint64_t totalSize = fileHeaderSize + informationHeaderSize + static_cast<std::uint64_t>(RowSize(width)) * rows;
+        const std::uint32_t fileSize = totalSize > 0xffffffffu ? 0 : static_cast<std::uint32_t>(totalSize);
 
+        unsigned char* fileHeader = header;
         // File type
         fileHeader[0] = 'B';
         fileHeader[1] = 'M';
@@ -69,7 +221,7 @@ public:
         fileHeader[12] = 0;
         fileHeader[13] = 0;
 
-        unsigned char informationHeader[informationHeaderSize];
+        unsigned char* informationHeader = header + fileHeaderSize;
 
         // Header size
         informationHeader[0] = informationHeaderSize;
@@ -77,15 +229,15 @@ public:
         informationHeader[2] = 0;
         informationHeader[3] = 0;
         // Image width
-        informationHeader[4] = m_width;
-        informationHeader[5] = m_width >> 8;
-        informationHeader[6] = m_width >> 16;
-        informationHeader[7] = m_width >> 24;
+        informationHeader[4] = width;
+        informationHeader[5] = width >> 8;
+        informationHeader[6] = width >> 16;
+        informationHeader[7] = width >> 24;
         // Image height
-        informationHeader[8] = m_height;
-        informationHeader[9] = m_height >> 8;
-        informationHeader[10] = m_height >> 16;
-        informationHeader[11] = m_height >> 24;
+        informationHeader[8] = height;
+        informationHeader[9] = height >> 8;
+        informationHeader[10] = height >> 16;
+        informationHeader[11] = height >> 24;
         // Planes
         informationHeader[12] = 1;
         informationHeader[13] = 0;
@@ -122,48 +274,1375 @@ public:
         informationHeader[37] = 0;
         informationHeader[38] = 0;
         informationHeader[39] = 0;
+    };
+
+    // Byte to float channel in [0, 1]. Every byte-to-float conversion goes through this
+    // rule (or divides by 255 the same way with SSE2), so a pixel reads the same either way.
+    static float ToFloat(unsigned char c) {
+        return c / 255.0f;
+    };
 
-        f.write(reinterpret_cast<char*>(fileHeader), fileHeaderSize);
-        f.write(reinterpret_cast<char*>(informationHeader), informationHeaderSize);
+    // Float channel to byte: truncated, not rounded, and clamped to [0, 255]; NaN gives 0
+    static unsigned char ToByte(float c) {
+        float v = std::min(255.0f, std::max(0.0f, c * 255.0f));
+        return static_cast<unsigned char>(static_cast<int>(v));
+    };
+
+    // Interleaved float RGB to BGR bytes with the same rounding as ToByte.
+    // With SSE2, four pixels at a time are swizzled to BGR as floats, then clamped,
+    // truncated and packed to bytes; the remaining pixels go through ToByte.
+    static void ConvertRow(const float* rgb, unsigned char* bgr, int width) {
+        int x = 0;
+#ifdef IMAGE_SSE2
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 zero = _mm_setzero_ps();
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128 p = _mm_loadu_ps(rgb + 3 * x);
+            __m128 q = _mm_loadu_ps(rgb + 3 * x + 4);
+            __m128 s = _mm_loadu_ps(rgb + 3 * x + 8);
+            SwapRedBlue(p, q, s);
+
+            // maxps returns its second operand for NaN, so NaN becomes 0 like in ToByte
+            const __m128i ip = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(p, scale), zero), scale));
+            const __m128i iq = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(q, scale), zero), scale));
+            const __m128i is = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(s, scale), zero), scale));
+            const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(ip, iq), _mm_packs_epi32(is, is));
 
-        for (int y = 0; y < m_height; y++)
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(bgr + 3 * x), bytes);
+            const int last = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+            std::memcpy(bgr + 3 * x + 8, &last, 4);
+        }
+#endif
+        for (; x < width; x++)
         {
-            for (int x = 0; x < m_width; x++)
+            bgr[3 * x + 0] = ToByte(rgb[3 * x + 2]);
+            bgr[3 * x + 1] = ToByte(rgb[3 * x + 1]);
+            bgr[3 * x + 2] = ToByte(rgb[3 * x + 0]);
+        }
+    };
+
+#ifdef IMAGE_SSE2
+    // Four packed 3-channel pixels in a, b, c (c0 c1 c2 c0 | c1 c2 c0 c1 | c2 c0 c1 c2):
+    // swaps channels 0 and 2 of every pixel, i.e. RGB <-> BGR
+    static void SwapRedBlue(__m128& a, __m128& b, __m128& c) {
+        const __m128 p = _mm_shuffle_ps(a, _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 2));
+        const __m128 q = _mm_shuffle_ps(_mm_shuffle_ps(b, a, _MM_SHUFFLE(3, 3, 0, 0)), _mm_shuffle_ps(c, b, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 s = _mm_shuffle_ps(_mm_shuffle_ps(b, c, _MM_SHUFFLE(3, 3, 2, 2)), c, _MM_SHUFFLE(1, 2, 2, 0));
+        a = p;
+        b = q;
+        c = s;
+    };
+#endif
+};
+
+// Read-only view of a 24- or 32-bit uncompressed BMP. The file is memory-mapped and
+// Row() points straight into the mapping, so nothing is copied or converted until
+// the caller asks for it. Rows are numbered like Image: y = 0 is the bottom row, for
+// both bottom-up and top-down (negative height) files.
+class BmpView
+{
+public:
+    BmpView() { };
+
+    explicit BmpView(const char* path) {
+        Open(path);
+    };
+
+    BmpView(const BmpView&) = delete;
+    BmpView& operator=(const BmpView&) = delete;
+
+    ~BmpView() {
+        Close();
+    };
+
+    bool Open(const char* path) {
+        Close();
+
+        if (!Map(path))
+        {
+            std::cout << "File could not be opened\n";
+            return false;
+        }
+        if (!ParseHeader())
+        {
+            std::cout << "Unsupported BMP file\n";
+            Close();
+            return false;
+        }
+        return true;
+    };
+
+    void Close() {
+        if (m_file != nullptr)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(m_file);
+#else
+            munmap(const_cast<unsigned char*>(m_file), m_fileSize);
+#endif
+        }
+        m_file = nullptr;
+        m_fileSize = 0;
+        m_pixels = nullptr;
+        m_width = 0;
+        m_height = 0;
+    };
+
+    bool IsOpen() const {
+        return m_pixels != nullptr;
+    };
+
+    int GetWidth() const {
+        return m_width;
+    };
+
+    int GetHeight() const {
+        return m_height;
+    };
+
+    // 3 for 24-bit (BGR), 4 for 32-bit (BGRA) files
+    int BytesPerPixel() const {
+        return m_bytesPerPixel;
+    };
+
+    const unsigned char* Row(int y) const {
+        return m_pixels + static_cast<ptrdiff_t>(y) * m_stride;
+    };
+
+    // Row y as interleaved float RGB in [0, 1], 3 * GetWidth() values, converted with
+    // Bmp::ToFloat. With SSE2, four pixels at a time are widened to floats and swizzled
+    // from BGR(A) to RGB; the remaining pixels are converted one by one.
+    void ReadRow(int y, float* rgb) const {
+        const unsigned char* src = Row(y);
+        const int bpp = m_bytesPerPixel;
+        int x = 0;
+#ifdef IMAGE_SSE2
+        // a division, not a multiply by 1/255, so the result matches Bmp::ToFloat exactly
+        const __m128 divisor = _mm_set1_ps(255.0f);
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 4 <= m_width; x += 4)
+        {
+            __m128 a, b, c;
+            if (bpp == 3)
+            {
+                // 12 bytes: b0 g0 r0 b1 | g1 r1 b2 g2 | r2 b3 g3 r3
+                int tail;
+                std::memcpy(&tail, src + 3 * x + 8, 4);
+                const __m128i bytes = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 3 * x)), _mm_cvtsi32_si128(tail));
+                const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+                const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+                a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+                b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+                c = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+                Bmp::SwapRedBlue(a, b, c);
+            }
+            else
             {
-                unsigned char r = static_cast<unsigned char>(GetColor(x, y).r * 255.0f);
-                unsigned char g = static_cast<unsigned char>(GetColor(x, y).g * 255.0f);
-                unsigned char b = static_cast<unsigned char>(GetColor(x, y).b * 255.0f);
+                // 16 bytes, one b g r a pixel per float vector
+                const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x));
+                const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+                const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+                const __m128 p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+                const __m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+                const __m128 p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+                const __m128 p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+                a = _mm_shuffle_ps(p0, _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 0, 1, 2));
+                b = _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(1, 2, 0, 1));
+                c = _mm_shuffle_ps(_mm_shuffle_ps(p2, p3, _MM_SHUFFLE(2, 2, 0, 0)), p3, _MM_SHUFFLE(0, 1, 2, 0));
+            }
+            _mm_storeu_ps(rgb + 3 * x, _mm_div_ps(a, divisor));
+            _mm_storeu_ps(rgb + 3 * x + 4, _mm_div_ps(b, divisor));
+            _mm_storeu_ps(rgb + 3 * x + 8, _mm_div_ps(c, divisor));
+        }
+#endif
+        for (; x < m_width; x++)
+        {
+            rgb[3 * x + 0] = Bmp::ToFloat(src[bpp * x + 2]);
+            rgb[3 * x + 1] = Bmp::ToFloat(src[bpp * x + 1]);
+            rgb[3 * x + 2] = Bmp::ToFloat(src[bpp * x + 0]);
+        }
+    };
+
+private:
+    static std::uint32_t ReadU32(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+    };
+
+    static std::uint16_t ReadU16(const unsigned char* p) {
+        return static_cast<std::uint16_t>(p[0] | (p[1] << 8));
+    };
+
+    bool Map(const char* path) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);
+        if (mapping == nullptr)
+        {
+            return false;
+        }
+        m_file = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        m_fileSize = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        m_file = static_cast<const unsigned char*>(p);
+        m_fileSize = static_cast<size_t>(st.st_size);
+#endif
+        return m_file != nullptr;
+    };
+
+    // Accepts what Export writes plus top-down and 32-bit files
+    bool ParseHeader() {
+        if (m_fileSize < static_cast<size_t>(Bmp::headerSize) || m_file[0] != 'B' || m_file[1] != 'M')
+        {
+            return false;
+        }
 
-                unsigned char color[] = { b, g, r };
+        const unsigned char* info = m_file + Bmp::fileHeaderSize;
+        const std::uint32_t offset = ReadU32(m_file + 10);
+        const std::uint32_t infoSize = ReadU32(info + 0);
+        const std::int32_t width = static_cast<std::int32_t>(ReadU32(info + 4));
+        const std::int32_t height = static_cast<std::int32_t>(ReadU32(info + 8));
+        const std::uint16_t planes = ReadU16(info + 12);
+        const std::uint16_t bitsPerPixel = ReadU16(info + 14);
+        const std::uint32_t compression = ReadU32(info + 16);
 
-                f.write(reinterpret_cast<char*>(color), 3);
+        if (infoSize < static_cast<std::uint32_t>(Bmp::informationHeaderSize) || planes != 1 || compression != 0)
+        {
+            return false;
+        }
+        if (bitsPerPixel != 24 && bitsPerPixel != 32)
+        {
+            return false;
+        }
+        if (width <= 0 || height == 0 || height == INT32_MIN)
+        {
+            return false;
+        }
+
+        const int rows = height < 0 ? -height : height;
+        const size_t stride = (static_cast<size_t>(width) * (bitsPerPixel / 8) + 3) & ~static_cast<size_t>(3);
+        if (offset < Bmp::fileHeaderSize + infoSize || offset > m_fileSize || (m_fileSize - offset) / stride < static_cast<size_t>(rows))
+        {
+            return false;
+        }
+
+        m_width = width;
+        m_height = rows;
+        m_bytesPerPixel = bitsPerPixel / 8;
+        if (height > 0)
+        {
+            m_pixels = m_file + offset;
+            m_stride = static_cast<ptrdiff_t>(stride);
+        }
+        else
+        {
+            m_pixels = m_file + offset + (rows - 1) * stride;
+            m_stride = -static_cast<ptrdiff_t>(stride);
+        }
+        return true;
+    };
+
+    const unsigned char* m_file = nullptr;
+    size_t m_fileSize = 0;
+    const unsigned char* m_pixels = nullptr;
+    ptrdiff_t m_stride = 0;
+    int m_width = 0;
+    int m_height = 0;
+    int m_bytesPerPixel = 0;
+};
+
+// Pixel formats. Each one names its channel type and count and converts a channel
+// to and from a float in [0, 1] and to a BMP byte.
+struct RGB8 {
+    using Channel = std::uint8_t;
+    static const int channels = 3;
+
+    static float ToFloat(Channel c) { return Bmp::ToFloat(c); };
+    static Channel FromFloat(float f) { return Bmp::ToByte(f); };
+    static unsigned char ToByte(Channel c) { return c; };
+};
+
+struct RGBA8 {
+    using Channel = std::uint8_t;
+    static const int channels = 4;
+
+    static float ToFloat(Channel c) { return Bmp::ToFloat(c); };
+    static Channel FromFloat(float f) { return Bmp::ToByte(f); };
+    static unsigned char ToByte(Channel c) { return c; };
+};
+
+struct RGBFloat {
+    using Channel = float;
+    static const int channels = 3;
+
+    static float ToFloat(Channel c) { return c; };
+    static Channel FromFloat(float f) { return f; };
+    static unsigned char ToByte(Channel c) { return Bmp::ToByte(c); };
+};
+
+// IEEE 754 binary16, stored as raw bits
+struct RGBHalf {
+    using Channel = std::uint16_t;
+    static const int channels = 3;
+
+    static float ToFloat(Channel h) {
+        std::uint32_t sign = static_cast<std::uint32_t>(h & 0x8000) << 16;
+        std::uint32_t exp = (h >> 10) & 0x1f;
+        std::uint32_t mant = h & 0x3ff;
+
+        if (exp == 0)
+        {
+            // zero or subnormal: mant * 2^-24
+            float v = mant * (1.0f / 16777216.0f);
+            return sign ? -v : v;
+        }
+
+        std::uint32_t bits = exp == 31
+            ? sign | 0x7f800000 | (mant << 13)
+            : sign | ((exp + 112) << 23) | (mant << 13);
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    };
+
+    // Rounds to nearest even
+    static Channel FromFloat(float f) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        std::uint32_t sign = (bits >> 16) & 0x8000;
+        std::uint32_t mant = bits & 0x7fffff;
+        int exp = static_cast<int>((bits >> 23) & 0xff) - 112;
+
+        if (exp == 143)
+        {
+            // infinity or NaN
+            return static_cast<Channel>(sign | 0x7c00 | (mant ? 0x200 : 0));
+        }
+        if (exp >= 31)
+        {
+            return static_cast<Channel>(sign | 0x7c00);
+        }
+
+        std::uint32_t half, rest, halfway;
+        if (exp <= 0)
+        {
+            if (exp < -10)
+            {
+                return static_cast<Channel>(sign);
+            }
+            mant |= 0x800000;
+            int shift = 14 - exp;
+            half = mant >> shift;
+            rest = mant & ((1u << shift) - 1);
+            halfway = 1u << (shift - 1);
+        }
+        else
+        {
+            half = (static_cast<std::uint32_t>(exp) << 10) | (mant >> 13);
+            rest = mant & 0x1fff;
+            halfway = 0x1000;
+        }
+
+        // a carry out of the mantissa correctly bumps the exponent
+        if (rest > halfway || (rest == halfway && (half & 1)))
+        {
+            half++;
+        }
+        return static_cast<Channel>(sign | half);
+    };
+
+    static unsigned char ToByte(Channel c) { return Bmp::ToByte(ToFloat(c)); };
+};
+
+// Interleaved keeps the channels of a pixel together (RGBRGB...), Planar keeps one
+// full plane per channel (RR..GG..BB..) so per-channel loops run over contiguous memory.
+enum class Layout {
+    Interleaved,
+    Planar
+};
+
+template <typename Format, Layout L = Layout::Interleaved>
+class BasicImage
+{
+public:
+    using Channel = typename Format::Channel;
+    static const int channels = Format::channels;
+
+    BasicImage(int width, int height)
+        : m_width(width), m_height(height), m_data(static_cast<size_t>(width) * height * channels, Channel()) {
+        if (channels == 4)
+        {
+            // opaque by default
+            for (int y = 0; y < m_height; y++)
+            {
+                for (int x = 0; x < m_width; x++)
+                {
+                    At(3, x, y) = Format::FromFloat(1.0f);
+                }
+            }
+        }
+    };
+
+    int GetWidth() const {
+        return m_width;
+    };
+
+    int GetHeight() const {
+        return m_height;
+    };
+
+    Color GetColor(int x, int y) const {
+        return Color(Format::ToFloat(At(0, x, y)), Format::ToFloat(At(1, x, y)), Format::ToFloat(At(2, x, y)));
+    };
+
+    void SetColor(const Color& color, int x, int y) {
+        At(0, x, y) = Format::FromFloat(color.r);
+        At(1, x, y) = Format::FromFloat(color.g);
+        At(2, x, y) = Format::FromFloat(color.b);
+    };
+
+    // Channel c (0 = r, 1 = g, 2 = b, 3 = a) of pixel (x, y)
+    Channel& At(int c, int x, int y) {
+        return m_data[Index(c, x, y)];
+    };
+
+    const Channel& At(int c, int x, int y) const {
+        return m_data[Index(c, x, y)];
+    };
+
+    Channel* Data() {
+        return m_data.data();
+    };
+
+    const Channel* Data() const {
+        return m_data.data();
+    };
+
+    // Interleaved only: the width * channels values of row y
+    Channel* Row(int y) {
+        static_assert(L == Layout::Interleaved, "Row() needs an interleaved image");
+        return m_data.data() + Index(0, 0, y);
+    };
+
+    const Channel* Row(int y) const {
+        static_assert(L == Layout::Interleaved, "Row() needs an interleaved image");
+        return m_data.data() + Index(0, 0, y);
+    };
+
+    // Planar only: the width * height values of channel c
+    Channel* Plane(int c) {
+        static_assert(L == Layout::Planar, "Plane() needs a planar image");
+        return m_data.data() + Index(c, 0, 0);
+    };
+
+    const Channel* Plane(int c) const {
+        static_assert(L == Layout::Planar, "Plane() needs a planar image");
+        return m_data.data() + Index(c, 0, 0);
+    };
+
+    // A run of `count` pixels of row y starting at column x, written through the raw
+    // channel pointers: pixel x + i has r[i * stride], g[i * stride], b[i * stride].
+    // stride is a compile-time constant, so the compiler is free to vectorize loops over a span.
+    struct Span {
+        static const int stride = L == Layout::Interleaved ? channels : 1;
+
+        Channel* r;
+        Channel* g;
+        Channel* b;
+        int x;
+        int y;
+        int count;
+    };
+
+    // Fills the image with f(x, y) -> Color, evaluated tile by tile on the pool
+    template <typename F>
+    void Generate(F f, ThreadPool& pool = ThreadPool::Instance()) {
+        ForEachTile([&](int x0, int y0, int x1, int y1) {
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    SetColor(f(x, y), x, y);
+                }
             }
+        }, pool);
+    };
 
-            f.write(reinterpret_cast<char*>(bmpPad), paddingAmount);
+    // Fills the image with f(span), called once per row of every tile; f writes the
+    // channels itself, so there is no Color temporary or per-pixel call
+    template <typename F>
+    void GenerateSpans(F f, ThreadPool& pool = ThreadPool::Instance()) {
+        ForEachTile([&](int x0, int y0, int x1, int y1) {
+            for (int y = y0; y < y1; y++)
+            {
+                Span span;
+                span.r = m_data.data() + Index(0, x0, y);
+                span.g = m_data.data() + Index(1, x0, y);
+                span.b = m_data.data() + Index(2, x0, y);
+                span.x = x0;
+                span.y = y;
+                span.count = x1 - x0;
+                f(span);
+            }
+        }, pool);
+    };
+
+    // Copy into another format and/or layout. Channels of the same type are copied
+    // as they are; anything else goes through float. A new alpha channel is opaque.
+    template <typename ToFormat, Layout ToLayout = L>
+    BasicImage<ToFormat, ToLayout> Convert() const {
+        BasicImage<ToFormat, ToLayout> out(m_width, m_height);
+        const int common = channels < ToFormat::channels ? channels : ToFormat::channels;
+        using Same = std::is_same<Channel, typename ToFormat::Channel>;
+
+        for (int c = 0; c < common; c++)
+        {
+            for (int y = 0; y < m_height; y++)
+            {
+                for (int x = 0; x < m_width; x++)
+                {
+                    out.At(c, x, y) = ConvertChannel<ToFormat>(At(c, x, y), Same());
+                }
+            }
+        }
+        return out;
+    };
+
+    // Copies a BMP view into a new image. 8-bit formats take the bytes as they are.
+    // Image (interleaved RGBFloat) is filled by BmpView::ReadRow straight into its rows,
+    // other formats convert from a float row. Alpha of 32-bit files is ignored.
+    static BasicImage FromBmp(const BmpView& view) {
+        BasicImage out(view.GetWidth(), view.GetHeight());
+        using Bytes = std::is_same<Channel, std::uint8_t>;
+        using RgbFloat = std::integral_constant<bool, std::is_same<Format, RGBFloat>::value && L == Layout::Interleaved>;
+        std::vector<float> row(Bytes::value || RgbFloat::value ? 0 : 3 * static_cast<size_t>(out.m_width));
+
+        for (int y = 0; y < out.m_height; y++)
+        {
+            if (Bytes::value)
+            {
+                out.ReadBmpBytes(view, y, Bytes());
+            }
+            else
+            {
+                out.ReadBmpFloats(view, y, row.data(), RgbFloat());
+            }
+        }
+        return out;
+    };
+
+    // Loads a 24- or 32-bit BMP; the image is empty (0 x 0) if the file cannot be read
+    static BasicImage Import(const char* path) {
+        BmpView view;
+        if (!view.Open(path))
+        {
+            return BasicImage(0, 0);
+        }
+        return FromBmp(view);
+    };
+
+    // Rows are converted into one buffer that holds the whole file, which is then
+    // written with a single call. Bands of rows are converted on the pool.
+    void Export(const char* path, ThreadPool& pool = ThreadPool::Instance()) const {
+        std::ofstream f;
+        f.open(path, std::ios::out | std::ios::binary);
+
+        if (!f.is_open())
+        {
+            std::cout << "File could not be opened\n";
+            return;
         }
 
+        const int rowSize = Bmp::RowSize(m_width);
+        std::vector<unsigned char> buffer(Bmp::headerSize + static_cast<size_t>(rowSize) * m_height, 0);
+
+        Bmp::WriteHeader(buffer.data(), m_width, m_height);
+
+        const int bandRows = 16;
+        pool.ParallelFor((m_height + bandRows - 1) / bandRows, [&](int band) {
+            const int yEnd = std::min(m_height, (band + 1) * bandRows);
+            for (int y = band * bandRows; y < yEnd; y++)
+            {
+                ConvertRow(y, buffer.data() + Bmp::headerSize + static_cast<size_t>(y) * rowSize);
+            }
+        });
+
+        f.write(reinterpret_cast<char*>(buffer.data()), buffer.size());
         f.close();
 
         std::cout << "File created\n";
     };
 
+    // Converts row y to BGR bytes. Interleaved float RGB, the layout of Image, goes
+    // through the SSE2 path of Bmp::ConvertRow; other formats convert channel by channel.
+    void ConvertRow(int y, unsigned char* dst) const {
+        using RgbFloat = std::integral_constant<bool, std::is_same<Format, RGBFloat>::value && L == Layout::Interleaved>;
+        ConvertRow(y, dst, RgbFloat());
+    };
+
 private:
+    void ConvertRow(int y, unsigned char* dst, std::true_type) const {
+        Bmp::ConvertRow(m_data.data() + Index(0, 0, y), dst, m_width);
+    };
+
+    void ConvertRow(int y, unsigned char* dst, std::false_type) const {
+        const int stride = L == Layout::Interleaved ? channels : 1;
+        const Channel* r = m_data.data() + Index(0, 0, y);
+        const Channel* g = m_data.data() + Index(1, 0, y);
+        const Channel* b = m_data.data() + Index(2, 0, y);
+
+        for (int x = 0; x < m_width; x++)
+        {
+            dst[3 * x + 0] = Format::ToByte(b[x * stride]);
+            dst[3 * x + 1] = Format::ToByte(g[x * stride]);
+            dst[3 * x + 2] = Format::ToByte(r[x * stride]);
+        }
+    };
+
+    size_t Index(int c, int x, int y) const {
+        if (L == Layout::Interleaved)
+        {
+            return (static_cast<size_t>(y) * m_width + x) * channels + c;
+        }
+        return (static_cast<size_t>(c) * m_height + y) * m_width + x;
+    };
+
+    static const int tileWidth = 256;
+    static const int tileHeight = 16;
+
+    // f(x0, y0, x1, y1) for every tile, in parallel
+    template <typename F>
+    void ForEachTile(const F& f, ThreadPool& pool) {
+        const int tilesX = (m_width + tileWidth - 1) / tileWidth;
+        const int tilesY = (m_height + tileHeight - 1) / tileHeight;
+
+        pool.ParallelFor(tilesX * tilesY, [&](int t) {
+            const int x0 = (t % tilesX) * tileWidth;
+            const int y0 = (t / tilesX) * tileHeight;
+            f(x0, y0, std::min(m_width, x0 + tileWidth), std::min(m_height, y0 + tileHeight));
+        });
+    };
+
+    void ReadBmpBytes(const BmpView& view, int y, std::true_type) {
+        const unsigned char* src = view.Row(y);
+        const int bpp = view.BytesPerPixel();
+        const int stride = L == Layout::Interleaved ? channels : 1;
+        Channel* r = m_data.data() + Index(0, 0, y);
+        Channel* g = m_data.data() + Index(1, 0, y);
+        Channel* b = m_data.data() + Index(2, 0, y);
+
+        for (int x = 0; x < m_width; x++)
+        {
+            b[x * stride] = src[bpp * x + 0];
+            g[x * stride] = src[bpp * x + 1];
+            r[x * stride] = src[bpp * x + 2];
+        }
+    };
+
+    void ReadBmpBytes(const BmpView&, int, std::false_type) { };
+
+    void ReadBmpFloats(const BmpView& view, int y, float*, std::true_type) {
+        view.ReadRow(y, reinterpret_cast<float*>(m_data.data() + Index(0, 0, y)));
+    };
+
+    void ReadBmpFloats(const BmpView& view, int y, float* row, std::false_type) {
+        view.ReadRow(y, row);
+
+        for (int x = 0; x < m_width; x++)
+        {
+            SetColor(Color(row[3 * x + 0], row[3 * x + 1], row[3 * x + 2]), x, y);
+        }
+    };
+
+    template <typename ToFormat>
+    static typename ToFormat::Channel ConvertChannel(Channel v, std::true_type) {
+        return v;
+    };
+
+    template <typename ToFormat>
+    static typename ToFormat::Channel ConvertChannel(Channel v, std::false_type) {
+        return ToFormat::FromFloat(Format::ToFloat(v));
+    };
+
     int m_width;
     int m_height;
-    std::vector<Color> m_colors;
+    std::vector<Channel> m_data;
+};
+
+using Image = BasicImage<RGBFloat>;
+
+// Writes a 24-bit BMP row by row, so only a batch of rows is held in memory however
+// large the image is. The header, including the file size, is written up front.
+// Rows arrive in file order: y = 0 is the bottom row, or the top row for a top-down file.
+// In async mode a background thread writes one batch while the caller fills the other.
+class BmpStreamWriter
+{
+public:
+    BmpStreamWriter(const char* path, int width, int height, bool async = false, bool topDown = false, int batchRows = 16)
+        : m_width(width), m_height(height), m_rowSize(Bmp::RowSize(width)), m_batchRows(std::max(1, batchRows)) {
+        m_file.open(path, std::ios::out | std::ios::binary);
+
+        if (!m_file.is_open())
+        {
+            std::cout << "File could not be opened\n";
+            return;
+        }
+
+        unsigned char header[Bmp::headerSize];
+        Bmp::WriteHeader(header, width, topDown ? -height : height);
+        m_file.write(reinterpret_cast<char*>(header), Bmp::headerSize);
+
+        for (auto& batch : m_batches)
+        {
+            batch.assign(static_cast<size_t>(m_rowSize) * m_batchRows, 0);
+        }
+        if (async)
+        {
+            m_thread = std::thread([this] { WriterLoop(); });
+        }
+    };
+
+    BmpStreamWriter(const BmpStreamWriter&) = delete;
+    BmpStreamWriter& operator=(const BmpStreamWriter&) = delete;
+
+    ~BmpStreamWriter() {
+        Close();
+    };
+
+    bool IsOpen() const {
+        return m_file.is_open();
+    };
+
+    // Rows past the height, or written after a failed open, are ignored
+    void WriteRow(const Color* row) {
+        if (!CanWrite())
+        {
+            return;
+        }
+        unsigned char* dst = NextRow();
+        for (int x = 0; x < m_width; x++)
+        {
+            dst[3 * x + 0] = Bmp::ToByte(row[x].b);
+            dst[3 * x + 1] = Bmp::ToByte(row[x].g);
+            dst[3 * x + 2] = Bmp::ToByte(row[x].r);
+        }
+        RowDone();
+    };
+
+    template <typename Format, Layout L>
+    void WriteRow(const BasicImage<Format, L>& image, int y) {
+        if (!CanWrite())
+        {
+            return;
+        }
+        image.ConvertRow(y, NextRow());
+        RowDone();
+    };
+
+    // Flushes the last batch and closes the file. Rows that were never written are
+    // filled with black, so the file is always complete. Returns false on I/O errors.
+    bool Close() {
+        if (!m_file.is_open())
+        {
+            return false;
+        }
+
+        while (m_rows < m_height)
+        {
+            std::memset(NextRow(), 0, m_rowSize);
+            RowDone();
+        }
+        Submit();
+
+        if (m_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_wake.notify_all();
+            m_thread.join();
+        }
+
+        const bool ok = !m_file.fail();
+        m_file.close();
+        return ok;
+    };
+
+    // Writes a whole file, asking producer(y, row) for each row's colors in file order
+    template <typename F>
+    static bool Write(const char* path, int width, int height, F producer, bool async = false) {
+        BmpStreamWriter writer(path, width, height, async);
+        if (!writer.IsOpen())
+        {
+            return false;
+        }
+
+        std::vector<Color> row(width);
+        for (int y = 0; y < height; y++)
+        {
+            producer(y, row.data());
+            writer.WriteRow(row.data());
+        }
+        return writer.Close();
+    };
+
+private:
+    bool CanWrite() const {
+        return m_file.is_open() && m_rows < m_height;
+    };
+
+    unsigned char* NextRow() {
+        return m_batches[m_fill].data() + static_cast<size_t>(m_filled) * m_rowSize;
+    };
+
+    void RowDone() {
+        m_rows++;
+        if (++m_filled == m_batchRows)
+        {
+            Submit();
+        }
+    };
+
+    // Hands the filled part of the current batch to the writer and switches batches
+    void Submit() {
+        if (m_filled == 0)
+        {
+            return;
+        }
+        if (!m_thread.joinable())
+        {
+            m_file.write(reinterpret_cast<char*>(m_batches[m_fill].data()), static_cast<std::streamsize>(m_filled) * m_rowSize);
+            m_filled = 0;
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this] { return m_pending < 0; });
+        m_pending = m_fill;
+        m_pendingRows = m_filled;
+        lock.unlock();
+        m_wake.notify_one();
+
+        m_fill = 1 - m_fill;
+        m_filled = 0;
+    };
+
+    void WriterLoop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait(lock, [this] { return m_stopping || m_pending >= 0; });
+            if (m_pending < 0)
+            {
+                return;
+            }
+
+            const int batch = m_pending;
+            const int rows = m_pendingRows;
+            lock.unlock();
+            m_file.write(reinterpret_cast<char*>(m_batches[batch].data()), static_cast<std::streamsize>(rows) * m_rowSize);
+            lock.lock();
+
+            m_pending = -1;
+            m_idle.notify_one();
+        }
+    };
+
+    std::ofstream m_file;
+    int m_width;
+    int m_height;
+    int m_rowSize;
+    int m_batchRows;
+    int m_rows = 0;
+
+    std::vector<unsigned char> m_batches[2];
+    int m_fill = 0;
+    int m_filled = 0;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    int m_pending = -1;
+    int m_pendingRows = 0;
+    bool m_stopping = false;
+};
+
+// Writes finished frames on a background thread while the caller renders the next
+// ones. At most queueSize frames wait in the queue (two by default, i.e. double
+// buffering); Submit blocks when it is full.
+class AsyncBmpWriter
+{
+public:
+    explicit AsyncBmpWriter(int queueSize = 2)
+        : m_queueSize(std::max(1, queueSize)), m_thread([this] { WorkerLoop(); }) { };
+
+    AsyncBmpWriter(const AsyncBmpWriter&) = delete;
+    AsyncBmpWriter& operator=(const AsyncBmpWriter&) = delete;
+
+    ~AsyncBmpWriter() {
+        Finish();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+    };
+
+    // Takes ownership of the frame; it is encoded and written to path in the background
+    template <typename Format, Layout L>
+    void Submit(const std::string& path, BasicImage<Format, L>&& frame) {
+        auto image = std::make_shared<BasicImage<Format, L>>(std::move(frame));
+        auto job = [path, image] {
+            BmpStreamWriter writer(path.c_str(), image->GetWidth(), image->GetHeight());
+            for (int y = 0; y < image->GetHeight(); y++)
+            {
+                writer.WriteRow(*image, y);
+            }
+            return writer.Close();
+        };
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this] { return static_cast<int>(m_jobs.size()) < m_queueSize; });
+        m_jobs.push_back(job);
+        lock.unlock();
+        m_wake.notify_one();
+    };
+
+    // Blocks until every submitted frame is on disk; returns the number of failed frames
+    int Finish() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this] { return m_jobs.empty() && !m_busy; });
+        const int failed = m_failed;
+        m_failed = 0;
+        return failed;
+    };
+
+private:
+    void WorkerLoop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_jobs.empty())
+            {
+                return;
+            }
+
+            std::function<bool()> job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_busy = true;
+            m_changed.notify_all();
+            lock.unlock();
+
+            const bool ok = job();
+
+            lock.lock();
+            m_busy = false;
+            if (!ok)
+            {
+                m_failed++;
+            }
+            m_changed.notify_all();
+        }
+    };
+
+    int m_queueSize;
+    std::deque<std::function<bool()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_changed;
+    bool m_busy = false;
+    bool m_stopping = false;
+    int m_failed = 0;
+    std::thread m_thread;
+};
+
+enum class ResizeFilter {
+    Bilinear,
+    Lanczos3
+};
+
+// Separable filters on BasicImage. Each channel goes through two passes over a float
+// plane, and every tap of either pass is one multiply-add over contiguous floats (Axpy,
+// SSE2 where it is available). The horizontal pass of Convolve works on whole rows,
+// padded so the inner loop has no border checks; Resize has a different set of taps per
+// output column, so it transposes a band of rows and adds up source columns instead.
+// The vertical pass works on column strips narrow enough to stay in L1 while it adds up
+// one input row per tap. Both passes run on the pool. Borders repeat the edge pixel.
+class ImageFilters
+{
+public:
+    // dst = src convolved with kernelX along rows and kernelY along columns. Both kernels
+    // need an odd number of taps. dst must have the same size and may be src itself.
+    template <typename Format, Layout L>
+    static void Convolve(const BasicImage<Format, L>& src, BasicImage<Format, L>& dst,
+        const std::vector<float>& kernelX, const std::vector<float>& kernelY, ThreadPool& pool = ThreadPool::Instance()) {
+        const int width = src.GetWidth();
+        const int height = src.GetHeight();
+
+        if (dst.GetWidth() != width || dst.GetHeight() != height)
+        {
+            std::cout << "Image sizes do not match\n";
+            return;
+        }
+        if (kernelX.size() % 2 == 0 || kernelY.size() % 2 == 0)
+        {
+            std::cout << "Kernel size must be odd\n";
+            return;
+        }
+        if (width == 0 || height == 0)
+        {
+            return;
+        }
+
+        const int rx = static_cast<int>(kernelX.size()) / 2;
+        const int ry = static_cast<int>(kernelY.size()) / 2;
+        std::vector<float> plane(static_cast<size_t>(width) * height);
+
+        for (int c = 0; c < BasicImage<Format, L>::channels; c++)
+        {
+            pool.ParallelFor(Bands(height), [&](int band) {
+                std::vector<float> padded(width + 2 * rx);
+                for (int y = band * bandRows; y < std::min(height, (band + 1) * bandRows); y++)
+                {
+                    LoadPadded(src, c, y, rx, padded.data());
+                    float* out = plane.data() + static_cast<size_t>(y) * width;
+                    std::fill(out, out + width, 0.0f);
+                    for (int t = 0; t < 2 * rx + 1; t++)
+                    {
+                        Axpy(kernelX[t], padded.data() + t, out, width);
+                    }
+                }
+            });
+
+            ForEachStrip(width, pool, [&](int x0, int x1, float* acc) {
+                for (int y = 0; y < height; y++)
+                {
+                    std::fill(acc, acc + (x1 - x0), 0.0f);
+                    for (int t = 0; t < 2 * ry + 1; t++)
+                    {
+                        const int sy = std::min(std::max(y + t - ry, 0), height - 1);
+                        Axpy(kernelY[t], plane.data() + static_cast<size_t>(sy) * width + x0, acc, x1 - x0);
+                    }
+                    Store(dst, c, x0, x1, y, acc);
+                }
+            });
+        }
+    };
+
+    // Gaussian blur; the kernel covers 3 sigma on each side. sigma <= 0 copies src.
+    template <typename Format, Layout L>
+    static void GaussianBlur(const BasicImage<Format, L>& src, BasicImage<Format, L>& dst, float sigma, ThreadPool& pool = ThreadPool::Instance()) {
+        if (!(sigma > 0.0f))
+        {
+            const std::vector<float> identity(1, 1.0f);
+            Convolve(src, dst, identity, identity, pool);
+            return;
+        }
+
+        const int radius = std::max(1, static_cast<int>(std::ceil(3.0f * sigma)));
+        std::vector<float> kernel(2 * radius + 1);
+        float sum = 0.0f;
+
+        for (int i = -radius; i <= radius; i++)
+        {
+            kernel[i + radius] = std::exp(-(i * i) / (2.0f * sigma * sigma));
+            sum += kernel[i + radius];
+        }
+        for (auto& k : kernel)
+        {
+            k /= sum;
+        }
+        Convolve(src, dst, kernel, kernel, pool);
+    };
+
+    // Mean over a (2 * radius + 1) square
+    template <typename Format, Layout L>
+    static void BoxBlur(const BasicImage<Format, L>& src, BasicImage<Format, L>& dst, int radius, ThreadPool& pool = ThreadPool::Instance()) {
+        if (radius < 0)
+        {
+            std::cout << "Blur radius must not be negative\n";
+            return;
+        }
+        std::vector<float> kernel(2 * radius + 1, 1.0f / (2 * radius + 1));
+        Convolve(src, dst, kernel, kernel, pool);
+    };
+
+    // Resamples src to the size of dst. When shrinking, the filter is widened by the
+    // scale factor so the result is antialiased.
+    template <typename Format, Layout L>
+    static void Resize(const BasicImage<Format, L>& src, BasicImage<Format, L>& dst, ResizeFilter filter = ResizeFilter::Bilinear, ThreadPool& pool = ThreadPool::Instance()) {
+        const int srcWidth = src.GetWidth();
+        const int srcHeight = src.GetHeight();
+        const int width = dst.GetWidth();
+        const int height = dst.GetHeight();
+
+        if (srcWidth == 0 || srcHeight == 0 || width == 0 || height == 0)
+        {
+            return;
+        }
+
+        const Contributions cx(srcWidth, width, filter);
+        const Contributions cy(srcHeight, height, filter);
+        std::vector<float> plane(static_cast<size_t>(width) * srcHeight);
+
+        for (int c = 0; c < BasicImage<Format, L>::channels; c++)
+        {
+            // The band is stored transposed, source column x at columns[x * columnRows], so
+            // every tap of an output column is one Axpy over the rows of the band
+            pool.ParallelFor((srcHeight + columnRows - 1) / columnRows, [&](int band) {
+                const int y0 = band * columnRows;
+                const int rows = std::min(srcHeight, y0 + columnRows) - y0;
+                std::vector<float> row(srcWidth);
+                std::vector<float> columns(static_cast<size_t>(srcWidth) * columnRows);
+                for (int r = 0; r < rows; r++)
+                {
+                    LoadPadded(src, c, y0 + r, 0, row.data());
+                    for (int x = 0; x < srcWidth; x++)
+                    {
+                        columns[static_cast<size_t>(x) * columnRows + r] = row[x];
+                    }
+                }
+
+                float acc[columnRows];
+                float* out = plane.data() + static_cast<size_t>(y0) * width;
+                for (int x = 0; x < width; x++)
+                {
+                    const float* w = cx.Weights(x);
+                    std::fill(acc, acc + rows, 0.0f);
+                    for (int t = 0; t < cx.taps; t++)
+                    {
+                        Axpy(w[t], columns.data() + static_cast<size_t>(cx.first[x] + t) * columnRows, acc, rows);
+                    }
+                    for (int r = 0; r < rows; r++)
+                    {
+                        out[static_cast<size_t>(r) * width + x] = acc[r];
+                    }
+                }
+            });
+
+            ForEachStrip(width, pool, [&](int x0, int x1, float* acc) {
+                for (int y = 0; y < height; y++)
+                {
+                    const float* w = cy.Weights(y);
+                    std::fill(acc, acc + (x1 - x0), 0.0f);
+                    for (int t = 0; t < cy.taps; t++)
+                    {
+                        Axpy(w[t], plane.data() + static_cast<size_t>(cy.first[y] + t) * width + x0, acc, x1 - x0);
+                    }
+                    Store(dst, c, x0, x1, y, acc);
+                }
+            });
+        }
+    };
+
+    // Prints the throughput of every filter in MPix/s (output pixels per second)
+    static void Benchmark(int width, int height, ThreadPool& pool = ThreadPool::Instance()) {
+        Image src(width, height);
+        src.Generate([&](int x, int y) {
+            return Color((float)x / (float)width, 1.0f - ((float)x / (float)width), (float)((x ^ y) & 255) / 255.0f);
+        }, pool);
+        Image same(width, height);
+        Image half(width / 2, height / 2);
+        Image twice(width * 2, height * 2);
+
+        std::cout << "Filters on " << width << "x" << height << ", " << pool.GetSize() << " threads\n";
+        Report("Gaussian blur (sigma 2)", same, [&] { GaussianBlur(src, same, 2.0f, pool); });
+        Report("Box blur (radius 3)", same, [&] { BoxBlur(src, same, 3, pool); });
+        Report("Bilinear resize 0.5x", half, [&] { Resize(src, half, ResizeFilter::Bilinear, pool); });
+        Report("Lanczos3 resize 0.5x", half, [&] { Resize(src, half, ResizeFilter::Lanczos3, pool); });
+        Report("Bilinear resize 2x", twice, [&] { Resize(src, twice, ResizeFilter::Bilinear, pool); });
+        Report("Lanczos3 resize 2x", twice, [&] { Resize(src, twice, ResizeFilter::Lanczos3, pool); });
+    };
+
+private:
+    static const int bandRows = 8;
+    static const int stripWidth = 512;
+    // rows per transposed band in the horizontal pass of Resize
+    static const int columnRows = 16;
+
+    // Per output coordinate: index of the first source sample and `taps` weights.
+    // Source indices are clamped to the image, so first + t is always valid.
+    struct Contributions {
+        int taps;
+        std::vector<int> first;
+        std::vector<float> weights;
+
+        Contributions(int srcSize, int dstSize, ResizeFilter filter) : first(dstSize) {
+            const float scale = static_cast<float>(srcSize) / dstSize;
+            const float filterScale = std::max(1.0f, scale);
+            const float support = (filter == ResizeFilter::Lanczos3 ? 3.0f : 1.0f) * filterScale;
+            taps = std::min(srcSize, static_cast<int>(std::ceil(2.0f * support)) + 1);
+            weights.assign(static_cast<size_t>(dstSize) * taps, 0.0f);
+
+            for (int i = 0; i < dstSize; i++)
+            {
+                const float center = (i + 0.5f) * scale - 0.5f;
+                first[i] = std::min(std::max(static_cast<int>(std::floor(center - support)) + 1, 0), srcSize - taps);
+                float* w = &weights[static_cast<size_t>(i) * taps];
+                float sum = 0.0f;
+
+                for (int j = static_cast<int>(std::floor(center - support)) + 1; j <= static_cast<int>(std::ceil(center + support)) - 1; j++)
+                {
+                    const float v = Kernel(filter, (j - center) / filterScale);
+                    const int t = std::min(std::max(j, 0), srcSize - 1) - first[i];
+                    if (t >= 0 && t < taps)
+                    {
+                        w[t] += v;
+                        sum += v;
+                    }
+                }
+                if (sum != 0.0f)
+                {
+                    for (int t = 0; t < taps; t++)
+                    {
+                        w[t] /= sum;
+                    }
+                }
+            }
+        };
+
+        const float* Weights(int i) const {
+            return &weights[static_cast<size_t>(i) * taps];
+        };
+    };
+
+    static float Kernel(ResizeFilter filter, float x) {
+        x = std::fabs(x);
+        if (filter == ResizeFilter::Bilinear)
+        {
+            return x < 1.0f ? 1.0f - x : 0.0f;
+        }
+        if (x < 1e-6f)
+        {
+            return 1.0f;
+        }
+        if (x >= 3.0f)
+        {
+            return 0.0f;
+        }
+        const float pi = 3.14159265358979f;
+        return 3.0f * std::sin(pi * x) * std::sin(pi * x / 3.0f) / (pi * pi * x * x);
+    };
+
+    static int Bands(int rows) {
+        return (rows + bandRows - 1) / bandRows;
+    };
+
+    // y += a * x
+    static void Axpy(float a, const float* x, float* y, int n) {
+        int i = 0;
+#ifdef IMAGE_SSE2
+        const __m128 va = _mm_set1_ps(a);
+        for (; i + 4 <= n; i += 4)
+        {
+            _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            y[i] += a * x[i];
+        }
+    };
+
+    // f(x0, x1, acc) for every strip of columns, in parallel; acc holds x1 - x0 floats
+    template <typename F>
+    static void ForEachStrip(int width, ThreadPool& pool, const F& f) {
+        pool.ParallelFor((width + stripWidth - 1) / stripWidth, [&](int strip) {
+            float acc[stripWidth];
+            const int x0 = strip * stripWidth;
+            f(x0, std::min(width, x0 + stripWidth), acc);
+        });
+    };
+
+    // Channel c of row y as floats, with the edge pixel repeated `pad` times on each side
+    template <typename Format, Layout L>
+    static void LoadPadded(const BasicImage<Format, L>& image, int c, int y, int pad, float* out) {
+        const int width = image.GetWidth();
+        const int stride = BasicImage<Format, L>::Span::stride;
+        const typename Format::Channel* in = &image.At(c, 0, y);
+
+        for (int x = 0; x < width; x++)
+        {
+            out[pad + x] = Format::ToFloat(in[x * stride]);
+        }
+        std::fill(out, out + pad, out[pad]);
+        std::fill(out + pad + width, out + 2 * pad + width, out[pad + width - 1]);
+    };
+
+    // 8-bit results are rounded rather than truncated, so filtering a flat area keeps its value
+    template <typename Format, Layout L>
+    static void Store(BasicImage<Format, L>& image, int c, int x0, int x1, int y, const float* values) {
+        const int stride = BasicImage<Format, L>::Span::stride;
+        const float bias = std::is_same<typename Format::Channel, std::uint8_t>::value ? 0.5f / 255.0f : 0.0f;
+        typename Format::Channel* out = &image.At(c, x0, y);
+
+        for (int x = 0; x < x1 - x0; x++)
+        {
+            out[x * stride] = Format::FromFloat(values[x] + bias);
+        }
+    };
+
+    template <typename F>
+    static void Report(const char* name, const Image& out, const F& run) {
+        run();
+        const int repeats = 5;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++)
+        {
+            run();
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+        const double mpix = static_cast<double>(out.GetWidth()) * out.GetHeight() / 1e6;
+        std::cout << name << ": " << mpix / seconds << " MPix/s\n";
+    };
 };
 
 int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], "bench") == 0)
+    {
+        ImageFilters::Benchmark(1920, 1080);
+        return 0;
+    }
+
     const int width = 1280;
     const int height = 720;
 
     Image image(width, height);
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            image.SetColor(Color((float)x / (float)width, 1.0f - ((float)x / (float)width), (float)y / (float)height), x, y);
-        }
-    }
+    image.Generate([&](int x, int y) {
+        return Color((float)x / (float)width, 1.0f - ((float)x / (float)width), (float)y / (float)height);
+    });
 
     image.Export("image.bmp");
     return 0;
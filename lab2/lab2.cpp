@@ -1,4 +1,27 @@
 ﻿#include <iostream>
+#include <vector>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <memory>
+#include <unordered_map>
+#include <type_traits>
+
+// SIMD for the GEMM micro-kernel: AVX when the compiler targets it (/arch:AVX, -mavx),
+// otherwise SSE2, which every x64 target has
+#if defined(__AVX__)
+#define GRID_AVX
+#include <immintrin.h>
+#elif defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRID_SSE2
+#include <emmintrin.h>
+#endif
 
 class Handler {
 	virtual void* data() = 0;
@@ -69,8 +92,8 @@ public:
 template <typename T>
 class Grid {
 private:
-	T* memory;
 	size_t x_size, y_size;
+	T* memory;
 
 public:
 	Grid(size_t x_size, size_t y_size) : x_size{ x_size }, y_size{ y_size }, memory{ new T[x_size * y_size] } {}
@@ -85,7 +108,7 @@ public:
 
 	Grid(Grid const& old) : x_size{ old.get_xsize() }, y_size{ old.get_ysize() }, memory{ new T[x_size * y_size] } {
 		for (size_t i = 0; i < x_size * y_size; ++i) {
-			memory[i] = old[i];
+			memory[i] = old.memory[i];
 		}
 	}
 
@@ -102,10 +125,10 @@ public:
 		this->memory = new T[x_size * y_size];
 
 		for (size_t i = 0; i < x_size * y_size; ++i) {
-			memory[i] = old[i];
+			memory[i] = old.memory[i];
 		}
 
-		return this;
+		return *this;
 	}
 
 	~Grid() {
@@ -113,11 +136,20 @@ public:
 	}
 
 	T operator()(size_t x_idx, size_t y_idx) const {
-		return memory[x_idx * x_size + y_idx];
+		return memory[y_idx * x_size + x_idx];
 	}
 
 	T& operator()(size_t x_idx, size_t y_idx) {
-		return memory[x_idx * x_size + y_idx];
+		return memory[y_idx * x_size + x_idx];
+	}
+
+	// rows are contiguous: element (x, y) lives at data()[y * get_xsize() + x]
+	T* data() {
+		return memory;
+	}
+
+	T const* data() const {
+		return memory;
 	}
 
 	friend std::ostream& operator<<(std::ostream& output, Grid const& grid) {
@@ -142,6 +174,876 @@ public:
 	}
 };
 
+// Grid for huge, mostly empty areas. Storage is split into Tile x Tile blocks that are
+// taken from a pool the first time they are written; reads from untouched blocks return
+// the default value. The non-const operator() returns a proxy that reads through get and
+// writes through set, so only assigning to an element allocates its tile.
+template <typename T, size_t Tile = 64>
+class SparseGrid {
+private:
+	static constexpr size_t tile_elements = Tile * Tile;
+	static constexpr size_t tiles_per_block = 64;
+
+	size_t x_size, y_size;
+	size_t tiles_x;
+	T default_value;
+
+	std::unordered_map<size_t, T*> tiles;
+	std::vector<std::unique_ptr<T[]>> blocks;
+	std::vector<T*> free_tiles;
+
+	size_t last_key = static_cast<size_t>(-1);
+	T* last_tile = nullptr;
+
+	size_t key(size_t x_idx, size_t y_idx) const {
+		return (y_idx / Tile) * tiles_x + x_idx / Tile;
+	}
+
+	static size_t offset(size_t x_idx, size_t y_idx) {
+		return (y_idx % Tile) * Tile + x_idx % Tile;
+	}
+
+	T* allocate_tile() {
+		if (free_tiles.empty()) {
+			blocks.emplace_back(new T[tiles_per_block * tile_elements]);
+			T* block = blocks.back().get();
+			for (size_t i = tiles_per_block; i > 0; --i) {
+				free_tiles.push_back(block + (i - 1) * tile_elements);
+			}
+		}
+		T* tile = free_tiles.back();
+		free_tiles.pop_back();
+		std::fill(tile, tile + tile_elements, default_value);
+		return tile;
+	}
+
+	T const* find_tile(size_t k) const {
+		auto it = tiles.find(k);
+		return it == tiles.end() ? nullptr : it->second;
+	}
+
+	T* touch_tile(size_t k) {
+		if (k == last_key) {
+			return last_tile;
+		}
+		T*& tile = tiles[k];
+		if (tile == nullptr) {
+			tile = allocate_tile();
+		}
+		last_key = k;
+		last_tile = tile;
+		return tile;
+	}
+
+public:
+	// element proxy returned by the non-const operator()
+	class Reference {
+	private:
+		SparseGrid& grid;
+		size_t x_idx, y_idx;
+
+		T& element() {
+			return grid.touch_tile(grid.key(x_idx, y_idx))[grid.offset(x_idx, y_idx)];
+		}
+
+	public:
+		Reference(SparseGrid& grid, size_t x_idx, size_t y_idx) : grid{ grid }, x_idx{ x_idx }, y_idx{ y_idx } {}
+
+		Reference(Reference const&) = default;
+
+		operator T() const {
+			return grid.get(x_idx, y_idx);
+		}
+
+		Reference& operator=(T const& value) {
+			grid.set(x_idx, y_idx, value);
+			return *this;
+		}
+
+		Reference& operator=(Reference const& other) {
+			return *this = static_cast<T>(other);
+		}
+
+		Reference& operator+=(T const& value) {
+			element() += value;
+			return *this;
+		}
+
+		Reference& operator-=(T const& value) {
+			element() -= value;
+			return *this;
+		}
+
+		Reference& operator*=(T const& value) {
+			element() *= value;
+			return *this;
+		}
+
+		Reference& operator/=(T const& value) {
+			element() /= value;
+			return *this;
+		}
+	};
+
+	SparseGrid(size_t x_size, size_t y_size, T default_value = T{})
+		: x_size{ x_size }, y_size{ y_size }, tiles_x{ (x_size + Tile - 1) / Tile }, default_value{ default_value } {}
+
+	SparseGrid(SparseGrid const&) = delete;
+	SparseGrid& operator=(SparseGrid const&) = delete;
+
+	// the last-tile cache is reset in the source so it cannot write into the new owner's tiles
+	SparseGrid(SparseGrid&& old)
+		: x_size{ old.x_size }, y_size{ old.y_size }, tiles_x{ old.tiles_x }, default_value{ std::move(old.default_value) },
+		tiles{ std::move(old.tiles) }, blocks{ std::move(old.blocks) }, free_tiles{ std::move(old.free_tiles) },
+		last_key{ old.last_key }, last_tile{ old.last_tile } {
+		old.tiles.clear();
+		old.free_tiles.clear();
+		old.last_key = static_cast<size_t>(-1);
+		old.last_tile = nullptr;
+	}
+
+	SparseGrid& operator=(SparseGrid&& old) {
+		if (this == &old) {
+			return *this;
+		}
+
+		x_size = old.x_size;
+		y_size = old.y_size;
+		tiles_x = old.tiles_x;
+		default_value = std::move(old.default_value);
+		tiles = std::move(old.tiles);
+		blocks = std::move(old.blocks);
+		free_tiles = std::move(old.free_tiles);
+		last_key = old.last_key;
+		last_tile = old.last_tile;
+
+		old.tiles.clear();
+		old.free_tiles.clear();
+		old.last_key = static_cast<size_t>(-1);
+		old.last_tile = nullptr;
+
+		return *this;
+	}
+
+	size_t get_xsize() const {
+		return x_size;
+	}
+
+	size_t get_ysize() const {
+		return y_size;
+	}
+
+	static constexpr size_t tile_size() {
+		return Tile;
+	}
+
+	size_t tile_count() const {
+		return tiles.size();
+	}
+
+	// bytes held by the tile pool, including tiles that were released
+	size_t memory_usage() const {
+		return blocks.size() * tiles_per_block * tile_elements * sizeof(T);
+	}
+
+	T get(size_t x_idx, size_t y_idx) const {
+		T const* tile = find_tile(key(x_idx, y_idx));
+		return tile == nullptr ? default_value : tile[offset(x_idx, y_idx)];
+	}
+
+	void set(size_t x_idx, size_t y_idx, T const& value) {
+		touch_tile(key(x_idx, y_idx))[offset(x_idx, y_idx)] = value;
+	}
+
+	T operator()(size_t x_idx, size_t y_idx) const {
+		return get(x_idx, y_idx);
+	}
+
+	Reference operator()(size_t x_idx, size_t y_idx) {
+		return Reference(*this, x_idx, y_idx);
+	}
+
+	// returns every tile to the pool; the pool memory itself is kept for reuse
+	void clear() {
+		for (auto& e : tiles) {
+			free_tiles.push_back(e.second);
+		}
+		tiles.clear();
+		last_key = static_cast<size_t>(-1);
+		last_tile = nullptr;
+	}
+
+	// f(x_begin, y_begin, x_end, y_end, tile) for every populated tile, in no particular
+	// order; element (x, y) of the tile is tile[(y - y_begin) * tile_size() + (x - x_begin)]
+	template <typename F>
+	void for_each_tile(F f) {
+		for (auto& e : tiles) {
+			size_t x0 = (e.first % tiles_x) * Tile;
+			size_t y0 = (e.first / tiles_x) * Tile;
+			f(x0, y0, std::min(x_size, x0 + Tile), std::min(y_size, y0 + Tile), e.second);
+		}
+	}
+
+	template <typename F>
+	void for_each_tile(F f) const {
+		for (auto const& e : tiles) {
+			size_t x0 = (e.first % tiles_x) * Tile;
+			size_t y0 = (e.first / tiles_x) * Tile;
+			f(x0, y0, std::min(x_size, x0 + Tile), std::min(y_size, y0 + Tile), static_cast<T const*>(e.second));
+		}
+	}
+};
+
+// Fixed set of workers that run parallel_for jobs. Chunks are claimed from a shared
+// atomic counter, so a worker that finishes early keeps taking work from the others.
+// The calling thread takes part in every job; jobs must not call parallel_for themselves.
+// If a job throws, the remaining indices are skipped and parallel_for rethrows the first
+// exception once every worker has stopped.
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::mutex submit_mutex;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	std::function<void(size_t)> job;
+	size_t job_count = 0;
+	std::atomic<size_t> next{ 0 };
+	size_t finished = 0;
+	std::exception_ptr error;
+	unsigned long long generation = 0;
+	bool stopping = false;
+
+	void run_job() {
+		try {
+			for (size_t i = next++; i < job_count; i = next++) {
+				job(i);
+			}
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+			next = job_count;
+		}
+	}
+
+	void worker_loop() {
+		unsigned long long seen = 0;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+
+			lock.unlock();
+			run_job();
+			lock.lock();
+
+			if (++finished == workers.size()) {
+				done.notify_one();
+			}
+		}
+	}
+
+public:
+	explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+		for (size_t i = 1; i < threads; ++i) {
+			workers.emplace_back([this] { worker_loop(); });
+		}
+	}
+
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& w : workers) {
+			w.join();
+		}
+	}
+
+	static ThreadPool& instance() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	size_t size() const {
+		return workers.size() + 1;
+	}
+
+	// calls f(i) for every i in [0, count)
+	template <typename F>
+	void parallel_for(size_t count, F const& f) {
+		if (workers.empty() || count < 2) {
+			for (size_t i = 0; i < count; ++i) {
+				f(i);
+			}
+			return;
+		}
+
+		std::lock_guard<std::mutex> submit(submit_mutex);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = [&f](size_t i) { f(i); };
+			job_count = count;
+			next = 0;
+			finished = 0;
+			error = nullptr;
+			++generation;
+		}
+		wake.notify_all();
+
+		run_job();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&] { return finished == workers.size(); });
+		job = nullptr;
+
+		std::exception_ptr failure = error;
+		error = nullptr;
+		lock.unlock();
+		if (failure) {
+			std::rethrow_exception(failure);
+		}
+	}
+};
+
+enum class Boundary {
+	Clamp,  // repeat the edge element
+	Mirror, // reflect without repeating the edge: -1 -> 1
+	Wrap,   // periodic grid
+	Zero    // everything outside is T{}
+};
+
+// Parallel algorithms over Grid. Work is split into bands of whole rows (or into
+// tiles for for_each_tile); the split depends only on the grid size, never on the
+// number of threads, so reduce gives bit-identical results on any machine.
+class GridAlgorithms {
+private:
+	static constexpr size_t band_elements = 1 << 16;
+
+	static size_t band_rows(size_t x_size) {
+		return std::max<size_t>(1, band_elements / std::max<size_t>(1, x_size));
+	}
+
+	static size_t band_count(size_t x_size, size_t y_size) {
+		size_t rows = band_rows(x_size);
+		return (y_size + rows - 1) / rows;
+	}
+
+	static long resolve(long i, long n, Boundary b) {
+		if (i >= 0 && i < n) {
+			return i;
+		}
+		switch (b) {
+		case Boundary::Clamp:
+			return i < 0 ? 0 : n - 1;
+		case Boundary::Mirror:
+			if (n == 1) {
+				return 0;
+			}
+			while (i < 0 || i >= n) {
+				i = i < 0 ? -i : 2 * (n - 1) - i;
+			}
+			return i;
+		case Boundary::Wrap:
+			return ((i % n) + n) % n;
+		default:
+			return -1;
+		}
+	}
+
+public:
+	// dst(x, y) = f(src(x, y)); dst must have the same size as src and may be src itself
+	template <typename T, typename U, typename F>
+	static void transform(Grid<T> const& src, Grid<U>& dst, F f, ThreadPool& pool = ThreadPool::instance()) {
+		size_t xs = src.get_xsize(), ys = src.get_ysize();
+		if (dst.get_xsize() != xs || dst.get_ysize() != ys) {
+			throw std::invalid_argument("transform: destination has wrong size");
+		}
+		size_t rows = band_rows(xs);
+		T const* in = src.data();
+		U* out = dst.data();
+
+		pool.parallel_for(band_count(xs, ys), [&](size_t band) {
+			size_t begin = band * rows * xs;
+			size_t end = std::min(ys, (band + 1) * rows) * xs;
+			for (size_t i = begin; i < end; ++i) {
+				out[i] = f(in[i]);
+			}
+		});
+	}
+
+	template <typename T, typename F>
+	static void transform(Grid<T>& grid, F f, ThreadPool& pool = ThreadPool::instance()) {
+		transform(grid, grid, f, pool);
+	}
+
+	// Every band folds its elements into a copy of init with op(R, T), and the band
+	// results are merged in band order with combine(R, R). init must therefore be an
+	// identity of combine (0 for a sum, 1 for a product) and combine must be associative.
+	template <typename T, typename R, typename Op, typename Combine>
+	static R reduce(Grid<T> const& grid, R init, Op op, Combine combine, ThreadPool& pool = ThreadPool::instance()) {
+		size_t xs = grid.get_xsize(), ys = grid.get_ysize();
+		size_t rows = band_rows(xs);
+		size_t bands = band_count(xs, ys);
+		T const* in = grid.data();
+
+		std::vector<R> partial(bands);
+		std::vector<char> used(bands, 0);
+		pool.parallel_for(bands, [&](size_t band) {
+			size_t begin = band * rows * xs;
+			size_t end = std::min(ys, (band + 1) * rows) * xs;
+			if (begin == end) {
+				return;
+			}
+			R acc = init;
+			for (size_t i = begin; i < end; ++i) {
+				acc = op(acc, in[i]);
+			}
+			partial[band] = acc;
+			used[band] = 1;
+		});
+
+		for (size_t band = 0; band < bands; ++band) {
+			if (used[band]) {
+				init = combine(init, partial[band]);
+			}
+		}
+		return init;
+	}
+
+	// reduce where op also merges band results, e.g. a sum or a max
+	template <typename T, typename R, typename Op>
+	static R reduce(Grid<T> const& grid, R init, Op op, ThreadPool& pool = ThreadPool::instance()) {
+		return reduce(grid, init, op, op, pool);
+	}
+
+	// f(x_begin, y_begin, x_end, y_end) is called once for every tile, in parallel
+	template <typename T, typename F>
+	static void for_each_tile(Grid<T>& grid, size_t tile_x, size_t tile_y, F f, ThreadPool& pool = ThreadPool::instance()) {
+		size_t xs = grid.get_xsize(), ys = grid.get_ysize();
+		tile_x = std::max<size_t>(1, tile_x);
+		tile_y = std::max<size_t>(1, tile_y);
+		size_t tiles_x = (xs + tile_x - 1) / tile_x;
+		size_t tiles_y = (ys + tile_y - 1) / tile_y;
+
+		pool.parallel_for(tiles_x * tiles_y, [&](size_t tile) {
+			size_t x0 = (tile % tiles_x) * tile_x;
+			size_t y0 = (tile / tiles_x) * tile_y;
+			f(x0, y0, std::min(xs, x0 + tile_x), std::min(ys, y0 + tile_y));
+		});
+	}
+
+	// dst(x, y) = sum of kernel[j][i] * src(x + i - K/2, y + j - K/2); K is 3 or 5.
+	// src and dst must be different grids of the same size.
+	template <size_t K, typename T, typename W>
+	static void stencil(Grid<T> const& src, Grid<T>& dst, std::array<std::array<W, K>, K> const& kernel,
+		Boundary boundary = Boundary::Clamp, ThreadPool& pool = ThreadPool::instance()) {
+		static_assert(K == 3 || K == 5, "stencil supports 3x3 and 5x5 kernels");
+		if (&src == &dst) {
+			throw std::invalid_argument("stencil: source and destination must be different grids");
+		}
+		if (dst.get_xsize() != src.get_xsize() || dst.get_ysize() != src.get_ysize()) {
+			throw std::invalid_argument("stencil: destination has wrong size");
+		}
+		const long r = K / 2;
+		const long xs = static_cast<long>(src.get_xsize());
+		const long ys = static_cast<long>(src.get_ysize());
+		size_t rows = band_rows(src.get_xsize());
+		T const* in = src.data();
+		T* out = dst.data();
+
+		auto at_edge = [&](long x, long y) {
+			T acc{};
+			for (long j = 0; j < static_cast<long>(K); ++j) {
+				long sy = resolve(y + j - r, ys, boundary);
+				for (long i = 0; i < static_cast<long>(K); ++i) {
+					long sx = resolve(x + i - r, xs, boundary);
+					if (sx >= 0 && sy >= 0) {
+						acc += kernel[j][i] * in[sy * xs + sx];
+					}
+				}
+			}
+			return acc;
+		};
+
+		pool.parallel_for(band_count(src.get_xsize(), src.get_ysize()), [&](size_t band) {
+			long y_begin = static_cast<long>(band * rows);
+			long y_end = std::min(ys, static_cast<long>((band + 1) * rows));
+			for (long y = y_begin; y < y_end; ++y) {
+				T* row = out + y * xs;
+				if (y < r || y >= ys - r || xs <= 2 * r) {
+					for (long x = 0; x < xs; ++x) {
+						row[x] = at_edge(x, y);
+					}
+					continue;
+				}
+
+				for (long x = 0; x < r; ++x) {
+					row[x] = at_edge(x, y);
+				}
+				for (long x = r; x < xs - r; ++x) {
+					T acc{};
+					for (long j = 0; j < static_cast<long>(K); ++j) {
+						T const* line = in + (y + j - r) * xs + (x - r);
+						for (long i = 0; i < static_cast<long>(K); ++i) {
+							acc += kernel[j][i] * line[i];
+						}
+					}
+					row[x] = acc;
+				}
+				for (long x = xs - r; x < xs; ++x) {
+					row[x] = at_edge(x, y);
+				}
+			}
+		});
+	}
+};
+
+// Vector register type and operations used by the GEMM micro-kernel for T.
+// enabled is false when there is no SIMD support for T on this target.
+template <typename T>
+struct GemmVector {
+	static constexpr bool enabled = false;
+	static constexpr size_t lanes = 1;
+};
+
+#if defined(GRID_AVX)
+template <>
+struct GemmVector<float> {
+	using reg = __m256;
+	static constexpr bool enabled = true;
+	static constexpr size_t lanes = 8;
+
+	static reg zero() { return _mm256_setzero_ps(); }
+	static reg load(float const* p) { return _mm256_loadu_ps(p); }
+	static reg broadcast(float const* p) { return _mm256_broadcast_ss(p); }
+	static void store(float* p, reg v) { _mm256_storeu_ps(p, v); }
+	static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+#if defined(__FMA__) || defined(__AVX2__)
+	static reg madd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+	static reg madd(reg a, reg b, reg c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+};
+
+template <>
+struct GemmVector<double> {
+	using reg = __m256d;
+	static constexpr bool enabled = true;
+	static constexpr size_t lanes = 4;
+
+	static reg zero() { return _mm256_setzero_pd(); }
+	static reg load(double const* p) { return _mm256_loadu_pd(p); }
+	static reg broadcast(double const* p) { return _mm256_broadcast_sd(p); }
+	static void store(double* p, reg v) { _mm256_storeu_pd(p, v); }
+	static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+#if defined(__FMA__) || defined(__AVX2__)
+	static reg madd(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+#else
+	static reg madd(reg a, reg b, reg c) { return _mm256_add_pd(_mm256_mul_pd(a, b), c); }
+#endif
+};
+#elif defined(GRID_SSE2)
+template <>
+struct GemmVector<float> {
+	using reg = __m128;
+	static constexpr bool enabled = true;
+	static constexpr size_t lanes = 4;
+
+	static reg zero() { return _mm_setzero_ps(); }
+	static reg load(float const* p) { return _mm_loadu_ps(p); }
+	static reg broadcast(float const* p) { return _mm_set1_ps(*p); }
+	static void store(float* p, reg v) { _mm_storeu_ps(p, v); }
+	static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+	static reg madd(reg a, reg b, reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+};
+
+template <>
+struct GemmVector<double> {
+	using reg = __m128d;
+	static constexpr bool enabled = true;
+	static constexpr size_t lanes = 2;
+
+	static reg zero() { return _mm_setzero_pd(); }
+	static reg load(double const* p) { return _mm_loadu_pd(p); }
+	static reg broadcast(double const* p) { return _mm_set1_pd(*p); }
+	static void store(double* p, reg v) { _mm_storeu_pd(p, v); }
+	static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+	static reg madd(reg a, reg b, reg c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+};
+#endif
+
+// Dense matrix operations on Grid: y is the row index, x is the column index,
+// so a rows x cols matrix is a Grid(cols, rows).
+class GridMatrix {
+private:
+	static constexpr size_t tile = 32;
+
+	// GEMM blocking: a KC x NC slice of B and an MC x KC block of A are packed into
+	// contiguous panels, then an MR x NR block of C is kept in registers while the
+	// micro-kernel walks the shared dimension. With SIMD, NR is two vector registers
+	// wide, so the MR x NR block is eight accumulator registers.
+	static constexpr size_t MR = 4;
+	static constexpr size_t KC = 256;
+	static constexpr size_t MC = 128;
+	static constexpr size_t NC = 2048;
+
+	template <typename T>
+	static constexpr size_t nr() {
+		return GemmVector<T>::enabled ? 2 * GemmVector<T>::lanes : 64 / sizeof(T);
+	}
+
+	// B[k0:k0+kc, j0:j0+nc] -> panels of NR columns, each stored row by row, zero padded
+	template <typename T>
+	static void pack_b(T const* b, size_t ldb, size_t k0, size_t kc, size_t j0, size_t nc, T* out) {
+		const size_t NR = nr<T>();
+		for (size_t jp = 0; jp < nc; jp += NR) {
+			size_t w = std::min(NR, nc - jp);
+			for (size_t p = 0; p < kc; ++p) {
+				T const* src = b + (k0 + p) * ldb + j0 + jp;
+				size_t j = 0;
+				for (; j < w; ++j) {
+					out[j] = src[j];
+				}
+				for (; j < NR; ++j) {
+					out[j] = T{};
+				}
+				out += NR;
+			}
+		}
+	}
+
+	// A[i0:i0+mc, k0:k0+kc] -> panels of MR rows, each stored column by column, zero padded
+	template <typename T>
+	static void pack_a(T const* a, size_t lda, size_t i0, size_t mc, size_t k0, size_t kc, T* out) {
+		for (size_t ip = 0; ip < mc; ip += MR) {
+			size_t h = std::min(MR, mc - ip);
+			for (size_t p = 0; p < kc; ++p) {
+				size_t i = 0;
+				for (; i < h; ++i) {
+					out[i] = a[(i0 + ip + i) * lda + k0 + p];
+				}
+				for (; i < MR; ++i) {
+					out[i] = T{};
+				}
+				out += MR;
+			}
+		}
+	}
+
+	// C[MR x NR] += A panel * B panel; only the top-left h x w part is stored
+	template <typename T>
+	static void micro_kernel(size_t kc, T const* a, T const* b, T* c, size_t ldc, size_t h, size_t w) {
+		micro_kernel(kc, a, b, c, ldc, h, w, std::integral_constant<bool, GemmVector<T>::enabled>());
+	}
+
+	// SIMD kernel: row i of the C block lives in the registers ci0, ci1
+	template <typename T>
+	static void micro_kernel(size_t kc, T const* a, T const* b, T* c, size_t ldc, size_t h, size_t w, std::true_type) {
+		static_assert(MR == 4, "the SIMD micro-kernel computes four rows");
+		using V = GemmVector<T>;
+		using reg = typename V::reg;
+		constexpr size_t L = V::lanes;
+
+		reg c00 = V::zero(), c01 = V::zero();
+		reg c10 = V::zero(), c11 = V::zero();
+		reg c20 = V::zero(), c21 = V::zero();
+		reg c30 = V::zero(), c31 = V::zero();
+
+		for (size_t p = 0; p < kc; ++p) {
+			const reg b0 = V::load(b);
+			const reg b1 = V::load(b + L);
+			reg ai = V::broadcast(a + 0);
+			c00 = V::madd(ai, b0, c00);
+			c01 = V::madd(ai, b1, c01);
+			ai = V::broadcast(a + 1);
+			c10 = V::madd(ai, b0, c10);
+			c11 = V::madd(ai, b1, c11);
+			ai = V::broadcast(a + 2);
+			c20 = V::madd(ai, b0, c20);
+			c21 = V::madd(ai, b1, c21);
+			ai = V::broadcast(a + 3);
+			c30 = V::madd(ai, b0, c30);
+			c31 = V::madd(ai, b1, c31);
+			a += MR;
+			b += 2 * L;
+		}
+
+		if (h == MR && w == 2 * L) {
+			T* row = c;
+			V::store(row, V::add(V::load(row), c00));
+			V::store(row + L, V::add(V::load(row + L), c01));
+			row += ldc;
+			V::store(row, V::add(V::load(row), c10));
+			V::store(row + L, V::add(V::load(row + L), c11));
+			row += ldc;
+			V::store(row, V::add(V::load(row), c20));
+			V::store(row + L, V::add(V::load(row + L), c21));
+			row += ldc;
+			V::store(row, V::add(V::load(row), c30));
+			V::store(row + L, V::add(V::load(row + L), c31));
+			return;
+		}
+
+		// edge block: spill to memory and add only the valid part
+		T acc[MR][2 * L];
+		V::store(acc[0], c00);
+		V::store(acc[0] + L, c01);
+		V::store(acc[1], c10);
+		V::store(acc[1] + L, c11);
+		V::store(acc[2], c20);
+		V::store(acc[2] + L, c21);
+		V::store(acc[3], c30);
+		V::store(acc[3] + L, c31);
+		for (size_t i = 0; i < h; ++i) {
+			T* row = c + i * ldc;
+			for (size_t j = 0; j < w; ++j) {
+				row[j] += acc[i][j];
+			}
+		}
+	}
+
+	// portable kernel for types without SIMD support
+	template <typename T>
+	static void micro_kernel(size_t kc, T const* a, T const* b, T* c, size_t ldc, size_t h, size_t w, std::false_type) {
+		constexpr size_t NR = nr<T>();
+		T acc[MR][NR] = {};
+		for (size_t p = 0; p < kc; ++p) {
+			for (size_t i = 0; i < MR; ++i) {
+				T ai = a[i];
+				for (size_t j = 0; j < NR; ++j) {
+					acc[i][j] += ai * b[j];
+				}
+			}
+			a += MR;
+			b += NR;
+		}
+
+		for (size_t i = 0; i < h; ++i) {
+			T* row = c + i * ldc;
+			for (size_t j = 0; j < w; ++j) {
+				row[j] += acc[i][j];
+			}
+		}
+	}
+
+public:
+	// dst = src^T; dst must be a different Grid(src.get_ysize(), src.get_xsize())
+	template <typename T>
+	static void transpose(Grid<T> const& src, Grid<T>& dst, ThreadPool& pool = ThreadPool::instance()) {
+		size_t xs = src.get_xsize(), ys = src.get_ysize();
+		if (&src == &dst) {
+			throw std::invalid_argument("transpose: use the in-place overload to transpose a grid into itself");
+		}
+		if (dst.get_xsize() != ys || dst.get_ysize() != xs) {
+			throw std::invalid_argument("transpose: destination has wrong size");
+		}
+		T const* in = src.data();
+		T* out = dst.data();
+		size_t tiles_x = (xs + tile - 1) / tile;
+		size_t tiles_y = (ys + tile - 1) / tile;
+
+		pool.parallel_for(tiles_x * tiles_y, [&](size_t t) {
+			size_t x0 = (t % tiles_x) * tile, x1 = std::min(xs, x0 + tile);
+			size_t y0 = (t / tiles_x) * tile, y1 = std::min(ys, y0 + tile);
+			for (size_t y = y0; y < y1; ++y) {
+				for (size_t x = x0; x < x1; ++x) {
+					out[x * ys + y] = in[y * xs + x];
+				}
+			}
+		});
+	}
+
+	// in-place transpose of a square grid
+	template <typename T>
+	static void transpose(Grid<T>& grid, ThreadPool& pool = ThreadPool::instance()) {
+		size_t n = grid.get_xsize();
+		if (grid.get_ysize() != n) {
+			throw std::invalid_argument("transpose: in-place transpose needs a square grid");
+		}
+		T* m = grid.data();
+		size_t tiles = (n + tile - 1) / tile;
+
+		pool.parallel_for(tiles, [&](size_t by) {
+			size_t y0 = by * tile, y1 = std::min(n, y0 + tile);
+			for (size_t bx = by; bx < tiles; ++bx) {
+				size_t x0 = bx * tile, x1 = std::min(n, x0 + tile);
+				for (size_t y = y0; y < y1; ++y) {
+					for (size_t x = (bx == by ? y + 1 : x0); x < x1; ++x) {
+						std::swap(m[y * n + x], m[x * n + y]);
+					}
+				}
+			}
+		});
+	}
+
+	// c = a * b; a is m x k, b is k x n and c must be a different m x n grid
+	template <typename T>
+	static void multiply(Grid<T> const& a, Grid<T> const& b, Grid<T>& c, ThreadPool& pool = ThreadPool::instance()) {
+		const size_t m = a.get_ysize(), k = a.get_xsize(), n = b.get_xsize();
+		if (b.get_ysize() != k || c.get_ysize() != m || c.get_xsize() != n) {
+			throw std::invalid_argument("multiply: matrix sizes do not match");
+		}
+		if (&c == &a || &c == &b) {
+			throw std::invalid_argument("multiply: result must not be one of the operands");
+		}
+		const size_t NR = nr<T>();
+		T const* pa = a.data();
+		T const* pb = b.data();
+		T* pc = c.data();
+
+		std::fill(pc, pc + m * n, T{});
+		if (k == 0) {
+			return;
+		}
+
+		std::vector<T> packed_b(KC * ((std::min(NC, n) + NR - 1) / NR) * NR);
+		size_t blocks = (m + MC - 1) / MC;
+
+		for (size_t j0 = 0; j0 < n; j0 += NC) {
+			size_t nc = std::min(NC, n - j0);
+			for (size_t k0 = 0; k0 < k; k0 += KC) {
+				size_t kc = std::min(KC, k - k0);
+				pack_b(pb, n, k0, kc, j0, nc, packed_b.data());
+
+				pool.parallel_for(blocks, [&](size_t block) {
+					thread_local std::vector<T> packed_a;
+					packed_a.resize(MC * KC);
+
+					size_t i0 = block * MC;
+					size_t mc = std::min(MC, m - i0);
+					pack_a(pa, k, i0, mc, k0, kc, packed_a.data());
+
+					for (size_t jr = 0; jr < nc; jr += NR) {
+						T const* panel_b = packed_b.data() + (jr / NR) * NR * kc;
+						for (size_t ir = 0; ir < mc; ir += MR) {
+							T const* panel_a = packed_a.data() + (ir / MR) * MR * kc;
+							micro_kernel(kc, panel_a, panel_b, pc + (i0 + ir) * n + j0 + jr, n,
+								std::min(MR, mc - ir), std::min(NR, nc - jr));
+						}
+					}
+				});
+			}
+		}
+	}
+};
+
+// out-of-class definitions: std::min/std::max take these by reference before C++17
+constexpr size_t GridMatrix::tile;
+constexpr size_t GridMatrix::MR;
+constexpr size_t GridMatrix::KC;
+constexpr size_t GridMatrix::MC;
+constexpr size_t GridMatrix::NC;
+
 int main(int argc, const char* argv[]) {
 
 	Grid<float> g(2, 3);